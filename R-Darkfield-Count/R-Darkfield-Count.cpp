@@ -2,6 +2,10 @@
 #include <iostream>
 #include <vector>
 #include <fstream>
+#include <cstdint>
+#include <cstdio>
+#include <climits>
+#include <algorithm>
 
 using namespace cv;
 
@@ -14,6 +18,7 @@ struct CellObject {
     int y; // Ͻǵy
     int width; // εؿ
     int height; // εظ߶
+    Rect cropRect; // ӾΣڵüͼ
 };
 
 double calculateCircularity(const std::vector<Point>& contour) {
@@ -32,6 +37,67 @@ double calculateCircularity(const std::vector<Point>& contour) {
     return circularity;
 }
 
+// ɫHSVΧcountCells ֡Ԥɸѡ
+const Scalar kLowerRed(0, 150, 60);   // ɫHSV½
+const Scalar kUpperRed(10, 255, 255); // ɫHSVϽ
+
+// ֡Ԥɸѡ
+const double kQualityScaleFactor = 0.25;  // Ⱥ͹ռڴ˱ĸ
+const double kMinFocus = 20.0;            // ϸ˹ޣڴֵΪʧδͼУ׼
+const double kMinOccupancy = 0.0003;      // ǰռޣڴֵΪ֡֡ϸԼ 0.16%
+const double kMaxSaturation = 0.05;       // ռ
+const int kSaturationLevel = 250;         // RͨﵽֵΪ
+const int kFocusMaskSize = 3;             // ʱϸΧС
+const bool kSkipLowQualityFrames = false; // У׼ǰֻǲϸ֡
+
+struct FrameQuality {
+    double focus;      // ȣϸ˹
+    double occupancy;  // ǰռ
+    double saturation; // ռ
+};
+
+FrameQuality assessFrameQuality(const Mat& image) {
+    FrameQuality quality;
+
+    // ԭֱϼǰռȣѽСϸƽ
+    Mat hsvImage;
+    cvtColor(image, hsvImage, COLOR_BGR2HSV);
+    Mat foreground;
+    inRange(hsvImage, kLowerRed, kUpperRed, foreground);
+    double totalPixels = static_cast<double>(foreground.total());
+    quality.occupancy = countNonZero(foreground) / totalPixels;
+
+    // Ⱥ͹ռڽRͨҶȻRͨĹѹ͵Լ 76
+    // ڳ INTER_AREA ƽȱԵĸƵɷ֣ҲС
+    Mat smallImage;
+    resize(image, smallImage, Size(), kQualityScaleFactor, kQualityScaleFactor, INTER_NEAREST);
+    Mat smallChannel;
+    extractChannel(smallImage, smallChannel, 2);
+
+    // ȣֻͳϸ˹ӦⱻƬϡ
+    Mat focusMask;
+    resize(foreground, focusMask, smallChannel.size(), 0, 0, INTER_NEAREST);
+    dilate(focusMask, focusMask, getStructuringElement(MORPH_RECT, Size(kFocusMaskSize, kFocusMaskSize)));
+    Mat laplacian;
+    Laplacian(smallChannel, laplacian, CV_16S);
+    Scalar meanValue, stdDevValue;
+    meanStdDev(laplacian, meanValue, stdDevValue, focusMask);
+    quality.focus = stdDevValue[0] * stdDevValue[0];
+
+    // ռ
+    Mat saturated;
+    threshold(smallChannel, saturated, kSaturationLevel - 1, 255, THRESH_BINARY);
+    quality.saturation = countNonZero(saturated) / static_cast<double>(saturated.total());
+
+    return quality;
+}
+
+bool passesQualityGate(const FrameQuality& quality) {
+    return quality.focus >= kMinFocus
+        && quality.occupancy >= kMinOccupancy
+        && quality.saturation <= kMaxSaturation;
+}
+
 Mat countCells(const Mat& image, std::vector<CellObject>& cellObjects) {
     // ͼԤҶȻֵ
     Mat hsvImage;
@@ -44,9 +110,7 @@ Mat countCells(const Mat& image, std::vector<CellObject>& cellObjects) {
 
     // ݺɫHSVΧĤ
     Mat mask;
-    Scalar lowerRed(0, 150, 60);   // ɫHSV½
-    Scalar upperRed(10, 255, 255);  // ɫHSVϽ
-    inRange(hsvImage, lowerRed, upperRed, mask);
+    inRange(hsvImage, kLowerRed, kUpperRed, mask);
 
     // ӦĤɫ
     Mat redImage;
@@ -159,6 +223,7 @@ Mat countCells(const Mat& image, std::vector<CellObject>& cellObjects) {
         cellObject.y = rectY;
         cellObject.width = rectWidth;
         cellObject.height = rectHeight;
+        cellObject.cropRect = cv::boundingRect(contour);
         cellObjects.push_back(cellObject);
 
         cellCount++;
@@ -197,6 +262,110 @@ void saveCellDataToExcel(const std::string& filePath, const std::vector<CellObje
     std::cout << "ϸѱ浽ļ" << filePath << std::endl;
 }
 
+// ϸüͼ
+const bool kExportCropAtlas = false;  // Ƿ񵼳ϸüͼ
+const int kCropAtlasSize = 64;        // ÿüͼͳһŵı߳
+const int kCropAtlasBatch = 4096;     // ÿüϸڴౣһԼ 48 MB
+
+// ͼļʽ汾 2ȫֽ򣬼 x64 ϵС򣩣
+// 32 ֽڵļͷΪ cellCount  24 ֽڵ
+//  64 ֽڶݣÿüͼΪ BGR ͨš
+// ¼ʵʲüľΣϸγͼʱֻͼڵĲ֣
+// ʱ cell_data.csv еľβͬȫԽʱΪ 0üͼȫ
+// üӾΣcropRectһ£
+// cell_data.csv еľתСӾĺͳߴ绻õصбϸһ
+struct CropAtlasHeader {
+    char magic[4];       // ̶Ϊ "CATL"
+    uint32_t version;    // ļʽ汾
+    uint32_t cellCount;  // üͼ cell_data.csv һһӦ
+    uint32_t cropWidth;  // üͼ
+    uint32_t cropHeight; // üͼ߶
+    uint32_t channels;   // ͨBGR Ϊ 3
+    uint64_t dataOffset; // һüͼļеƫ
+};
+static_assert(sizeof(CropAtlasHeader) == 32, "CropAtlasHeader must stay 32 bytes");
+
+struct CropAtlasEntry {
+    uint64_t offset; // üͼļеƫ
+    int32_t x;       // ʵʲüϽǵx
+    int32_t y;       // ʵʲüϽǵy
+    int32_t width;   // ʵʲüεĿ
+    int32_t height;  // ʵʲüεĸ߶
+};
+static_assert(sizeof(CropAtlasEntry) == 24, "CropAtlasEntry must stay 24 bytes");
+
+bool saveCellCropAtlas(const std::string& filePath, const Mat& image, const std::vector<CellObject>& cellObjects) {
+    // вü int ±ϸ int Χʱܾ
+    if (cellObjects.size() > static_cast<size_t>(INT_MAX)) {
+        return false;
+    }
+    int cellCount = static_cast<int>(cellObjects.size());
+    uint64_t cropBytes = static_cast<uint64_t>(kCropAtlasSize) * kCropAtlasSize * image.channels();
+    Rect imageRect(0, 0, image.cols, image.rows);
+
+    // ݰ 64 ֽڶ룬ڴӳֱӷ
+    CropAtlasHeader header = { { 'C', 'A', 'T', 'L' }, 2, static_cast<uint32_t>(cellCount),
+        static_cast<uint32_t>(kCropAtlasSize), static_cast<uint32_t>(kCropAtlasSize),
+        static_cast<uint32_t>(image.channels()), 0 };
+    uint64_t indexEnd = sizeof(header) + sizeof(CropAtlasEntry) * static_cast<uint64_t>(cellCount);
+    header.dataOffset = (indexEnd + 63) / 64 * 64;
+
+    // ¼õԽ粿ֺʵʹõľ
+    std::vector<CropAtlasEntry> entries(cellCount);
+    for (int i = 0; i < cellCount; i++) {
+        const auto& cell = cellObjects[i];
+        Rect cellRect = cell.cropRect & imageRect;
+        entries[i] = { header.dataOffset + cropBytes * i, cellRect.x, cellRect.y, cellRect.width, cellRect.height };
+    }
+
+    // дļͷ
+    std::ofstream file(filePath, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(entries.data()), sizeof(CropAtlasEntry) * entries.size());
+    std::vector<char> padding(static_cast<size_t>(header.dataOffset - indexEnd), 0);
+    file.write(padding.data(), padding.size());
+
+    // ڴеԭͼвüţٴζȡͼ
+    Mat batch(std::min(kCropAtlasBatch, cellCount) * kCropAtlasSize, kCropAtlasSize, image.type());
+    for (int first = 0; first < cellCount && file; first += kCropAtlasBatch) {
+        int batchCount = std::min(kCropAtlasBatch, cellCount - first);
+        batch.setTo(Scalar::all(0));
+
+        parallel_for_(Range(0, batchCount), [&](const Range& range) {
+            for (int i = range.start; i < range.end; i++) {
+                const auto& entry = entries[first + i];
+
+                // ȫԽʱȫĲüͼ֤ϸ
+                if (entry.width == 0 || entry.height == 0) {
+                    continue;
+                }
+
+                // Сʱ INTER_AREAŴʱ INTER_AREA ڣ INTER_LINEAR
+                bool shrinking = entry.width >= kCropAtlasSize && entry.height >= kCropAtlasSize;
+                int interpolation = shrinking ? INTER_AREA : INTER_LINEAR;
+
+                Mat crop = batch.rowRange(i * kCropAtlasSize, (i + 1) * kCropAtlasSize);
+                resize(image(Rect(entry.x, entry.y, entry.width, entry.height)), crop, crop.size(), 0, 0, interpolation);
+            }
+        });
+
+        file.write(reinterpret_cast<const char*>(batch.data), cropBytes * batchCount);
+    }
+
+    // رļκһдʧܶΪͼ
+    file.close();
+    if (!file) {
+        std::remove(filePath.c_str());  // ɾȱͼΰƫԽȡ
+        return false;
+    }
+
+    std::cout << "ϸüͼѱ浽ļ" << filePath << std::endl;
+    return true;
+}
+
 int main() {
     // ȡͼ
     std::string filePath = "D:\\Study\\ECNU-Proj\\Cells\\Pics\\Image_20230607092533944.bmp";  //dark field red example
@@ -215,6 +384,27 @@ int main() {
         return -1;
     }
 
+    std::string excelFilePath = "cell_data.csv";
+    std::string atlasFilePath = "cell_crops.atlas";
+
+    // ֡Ԥɸѡʧհ׻ص֡
+    FrameQuality quality = assessFrameQuality(image);
+    std::cout << "֡:  " << quality.focus << ", ǰռ " << quality.occupancy
+        << ", ռ " << quality.saturation << std::endl;
+    if (!passesQualityGate(quality)) {
+        if (kSkipLowQualityFrames) {
+            // дֻбͷCSVλʱһ֡Ľ
+            saveCellDataToExcel(excelFilePath, std::vector<CellObject>());
+            if (kExportCropAtlas && !saveCellCropAtlas(atlasFilePath, image, std::vector<CellObject>())) {
+                std::cout << "޷дϸüͼļ" << std::endl;
+                return -1;
+            }
+            std::cout << "֡ϸ֡" << std::endl;
+            return 1;  // ڶȡʧʱ -1
+        }
+        std::cout << "棺֡ϸͳƽܲɿ" << std::endl;
+    }
+
     std::vector<CellObject> cellObjects;
     Mat outputImage = countCells(image, cellObjects);
 
@@ -249,8 +439,13 @@ int main() {
     std::cout << std::endl;
 
     // ϸݱ浽Excelļ
-    std::string excelFilePath = "cell_data.csv";
     saveCellDataToExcel(excelFilePath, cellObjects);
 
+    // ϸüͼηʹ
+    if (kExportCropAtlas && !saveCellCropAtlas(atlasFilePath, image, cellObjects)) {
+        std::cout << "޷дϸüͼļ" << std::endl;
+        return -1;
+    }
+
     return 0;
 }